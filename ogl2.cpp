@@ -1,15 +1,20 @@
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <fmt/core.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include "fast_sin.hpp"
+#include "row_workers.hpp"
 #include <memory>
+#include <span>
 #include <chrono>
 #include <ratio>
 #include <thread>
 #include <tuple>
+#include <vector>
 
 
 class Timer {
@@ -74,7 +79,7 @@ void resize(GLFWwindow* window, int width, int height) {
 }
 
 template<typename T>
-void compute_image(Image<T> & img) {
+void compute_image(Image<T> & img, RowWorkers & workers) {
     auto time = std::chrono::steady_clock::now();
     std::chrono::duration<float> m = time.time_since_epoch();
     float int_part;
@@ -82,15 +87,22 @@ void compute_image(Image<T> & img) {
     float extra = fract_part * 2 * M_PIf32;
     float fx = 2 * M_PIf32 / ((float) img.width() - 1);
     float fy = 2 * M_PIf32 / ((float) img.height() - 1);
-    for (int x = 0; x < img.width(); ++x) {
-        for (int y = 0; y < img.height(); ++y) {
-            auto& f = img(x, y);
-            //float *f = &data[3 * (img.width() * y + x)];
-            f[0] = 0.5f + 0.5 * sinf(x * fx + extra );
-            f[1] = 0.5f + 0.5 * sinf(y * fy + extra);
-            f[2] = 0.5f + 0.5 * cosf(y * fy + extra - M_PIf32);
+    // channel 0 depends on x only, channels 1 and 2 on y only
+    std::vector<float> col0(img.width());
+    std::vector<float> row1(img.height());
+    std::vector<float> row2(img.height());
+    sin_table(col0, fx, extra, 0.5f, 0.5f);
+    sin_table(row1, fy, extra, 0.5f, 0.5f);
+    // cos(a - pi) = sin(a - pi/2)
+    sin_table(row2, fy, extra - 0.5f * M_PIf32, 0.5f, 0.5f);
+    workers.run([&](unsigned y_begin, unsigned y_end) {
+        for (unsigned y = y_begin; y < y_end; ++y) {
+            auto* f = img.row_ptr(y);
+            float const r1 = row1[y], r2 = row2[y];
+            for (unsigned x = 0; x < img.width(); ++x)
+                f[x] = { col0[x], r1, r2 };
         }
-    }
+    });
 }
 
 int main(int argc, char const *argv[]) {
@@ -126,8 +138,10 @@ int main(int argc, char const *argv[]) {
   int width = 256;
   int height = 256;
   Image<std::array<float, 3>> img(width, height);
+  // compute_image runs on the render thread, which waits for it anyway
+  RowWorkers workers(height, std::thread::hardware_concurrency());
 
-  compute_image(img);
+  compute_image(img, workers);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, img.begin());
   glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -199,7 +213,7 @@ int main(int argc, char const *argv[]) {
 
     glBindTexture(GL_TEXTURE_2D, texture);
     //compute_texture(width, height, data);
-    compute_image(img);
+    compute_image(img, workers);
     //glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, data.get());
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, img.begin());
     glBindVertexArray(VAO);
@@ -1,17 +1,27 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <fmt/core.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include "row_workers.hpp"
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <chrono>
 #include <random>
 #include <ratio>
+#include <span>
+#include <string_view>
 #include <thread>
 #include <tuple>
+#include <vector>
 
 
 class Timer {
@@ -66,6 +76,8 @@ public:
     }
     auto begin() { return data_.get(); }
     auto end() { return data_.get() + len_ ; }
+    auto begin() const { return static_cast<ELT const*>(data_.get()); }
+    auto end() const { return static_cast<ELT const*>(data_.get() + len_); }
     auto size() const noexcept { return len_; }
     auto width() const noexcept { return width_; }
     auto height() const noexcept { return height_; }
@@ -79,11 +91,13 @@ void resize(GLFWwindow* window, int width, int height) {
 }
 
 template<typename T>
-void compute_image(Image<T> const * src, Image<T>* tgt) {
+void compute_image(Image<T> const * src, Image<T>* tgt, unsigned y_begin, unsigned y_end) {
     auto const & s = *src;
     auto& t = *tgt;
     unsigned border = 4;
-    for(unsigned y = border; y < src->height() - border; ++y) {
+    y_begin = std::max(y_begin, border);
+    y_end = std::min(y_end, src->height() - border);
+    for(unsigned y = y_begin; y < y_end; ++y) {
         for(unsigned x = border; x < src->width() - border; ++x) {
             float avg = 0.f;
             for(unsigned by = y - border; by < y + border + 1; ++by) {
@@ -98,7 +112,343 @@ void compute_image(Image<T> const * src, Image<T>* tgt) {
 
 }
 
+/**
+ * @brief lock-free triple buffer between one producer (simulation) and one
+ * consumer (render thread). The producer writes into back() and publishes it,
+ * the consumer always takes the latest published image. Neither side waits
+ * for the other; frames the consumer did not take in time are replaced.
+ * All three images start as a copy of the initial image which is published
+ * as frame 0.
+ * Each image also carries a mark with the step last written into it, kept
+ * outside the image data, so the consumer can verify that the producer never
+ * writes into the front image.
+ */
+template<typename T>
+class TripleBuffer {
+public:
+    explicit TripleBuffer(Image<T> const & initial)
+    : images_{copy_of(initial), copy_of(initial), copy_of(initial)}
+    {}
+
+    // producer side
+    Image<T>& back() noexcept { return images_[back_]; }
+    Image<T> const& last_published() const noexcept { return images_[last_]; }
+    /// marks back() as being written for step seq, call before writing
+    void mark_back(uint64_t seq) noexcept { marks_[back_].store(seq); }
+    /**
+     * @brief makes back() the latest image and hands out a new back buffer
+     * @return     true if the image published before was never acquired
+     */
+    bool publish(uint64_t seq) noexcept {
+        seq_[back_] = seq;
+        last_ = back_;
+        unsigned old = ready_.exchange(back_ | fresh_bit, std::memory_order_acq_rel);
+        back_ = old & index_mask;
+        return old & fresh_bit;
+    }
+
+    // consumer side
+    /**
+     * @brief makes the latest published image the front image
+     * @return     false if nothing was published since the last call
+     */
+    bool acquire() noexcept {
+        if (!pending())
+            return false;
+        unsigned old = ready_.exchange(front_, std::memory_order_acq_rel);
+        front_ = old & index_mask;
+        return true;
+    }
+    /// true if an image was published which was not acquired yet
+    bool pending() const noexcept {
+        return ready_.load(std::memory_order_relaxed) & fresh_bit;
+    }
+    Image<T> const& front() const noexcept { return images_[front_]; }
+    uint64_t front_seq() const noexcept { return seq_[front_]; }
+    /// equals front_seq() unless the producer wrote into the front image
+    uint64_t front_mark() const noexcept { return marks_[front_].load(); }
+
+protected:
+    static constexpr unsigned index_mask = 3, fresh_bit = 4;
+
+    static Image<T> copy_of(Image<T> const & img) {
+        Image<T> r(img.width(), img.height());
+        std::copy(img.begin(), img.end(), r.begin());
+        return r;
+    }
+
+    std::array<Image<T>, 3> images_;
+    std::array<uint64_t, 3> seq_{};
+    std::array<std::atomic<uint64_t>, 3> marks_{};
+    unsigned back_ = 0, front_ = 1, last_ = 2;
+    std::atomic<unsigned> ready_{2 | fresh_bit};
+};
+
+/**
+ * @brief runs the diffusion on its own thread into a TripleBuffer with a fixed
+ * number of steps per second (0: as fast as possible, see check_rate for
+ * valid values), independent of the display rate.
+ * Each step is split into bands of rows by RowWorkers which live as long as
+ * the simulation thread; band 0 is computed by the simulation thread itself.
+ * - dropped: steps which were replaced before the render thread took them
+ * - late   : steps which did not finish within 1 / steps_per_second
+ */
+template<typename T>
+class Simulation {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    explicit Simulation(TripleBuffer<T>& buffers, float steps_per_second)
+    : buffers_{buffers}
+    , period_{steps_per_second > 0.f
+        ? std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<float>(1.f / steps_per_second))
+        : clock_type::duration::zero()}
+    {}
+    ~Simulation() { stop(); }
+
+    void start() {
+        thread_ = std::jthread([this](std::stop_token st) { run(st); });
+    }
+    void stop() {
+        thread_.request_stop();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    uint64_t steps() const noexcept { return steps_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const noexcept { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t late() const noexcept { return late_.load(std::memory_order_relaxed); }
+
+protected:
+    void run(std::stop_token st) {
+        // one core less than available so the render thread keeps one
+        RowWorkers workers(buffers_.back().height(),
+            std::max(1u, std::thread::hardware_concurrency()) - 1);
+        auto next = clock_type::now();
+        uint64_t seq = 0;
+        while (!st.stop_requested()) {
+            buffers_.mark_back(seq + 1);
+            workers.run([this](unsigned y_begin, unsigned y_end) {
+                compute_image(&buffers_.last_published(), &buffers_.back(), y_begin, y_end);
+            });
+            if (buffers_.publish(++seq))
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            steps_.store(seq, std::memory_order_relaxed);
+            if (period_ == clock_type::duration::zero())
+                continue;
+            next += period_;
+            auto now = clock_type::now();
+            if (now > next) {
+                late_.fetch_add(1, std::memory_order_relaxed);
+                next = now;
+            } else {
+                // wakes up early when stop() is requested
+                std::unique_lock lock(wait_mutex_);
+                wait_cv_.wait_until(lock, st, next, [] { return false; });
+            }
+        }
+    }
+
+    TripleBuffer<T>& buffers_;
+    clock_type::duration const period_;
+    std::mutex wait_mutex_;
+    std::condition_variable_any wait_cv_;
+    std::atomic<uint64_t> steps_{0}, dropped_{0}, late_{0};
+    std::jthread thread_;
+};
+
+/**
+ * @brief counts what the render thread got from the TripleBuffer per frame
+ * - presented: frames with a new image
+ * - repeated : frames without a new image (the previous one is shown again)
+ * - errors   : new images which were not newer than the previous one
+ */
+struct PresentStats {
+    uint64_t presented = 0, repeated = 0, errors = 0, last_seq = 0;
+
+    template<typename T>
+    bool update(TripleBuffer<T>& buffers) {
+        if (!buffers.acquire()) {
+            ++repeated;
+            return false;
+        }
+        ++presented;
+        if (buffers.front_seq() <= last_seq && presented > 1)
+            ++errors;
+        last_seq = buffers.front_seq();
+        return true;
+    }
+};
+
+struct Options {
+    bool headless = false;
+    unsigned frames = 600;
+    unsigned size = 1024;
+    float steps_per_second = 60.f;      // 0: as fast as possible
+    float frames_per_second = 60.f;     // 0: no frame cap
+};
+
+/**
+ * @brief parses the value following option argv[i] into out
+ * @return     false (with a message) if the value is missing or invalid
+ */
+template<typename V>
+bool parse_value(int argc, char const *argv[], int& i, V& out) {
+    std::string_view opt = argv[i];
+    if (i + 1 >= argc) {
+        fmt::println(stderr, "Fehlender Wert für Option {}", opt);
+        return false;
+    }
+    std::string_view val = argv[++i];
+    auto [ptr, ec] = std::from_chars(val.data(), val.data() + val.size(), out);
+    if (ec != std::errc{} || ptr != val.data() + val.size()) {
+        fmt::println(stderr, "Ungültiger Wert für Option {}: {}", opt, val);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief a rate is either 0 (no limit) or at least min_rate per second so
+ * that 1 / rate fits into a steady_clock::duration
+ */
+bool check_rate(std::string_view opt, float rate) {
+    static constexpr float min_rate = 0.01f;
+    if (rate == 0.f || (std::isfinite(rate) && rate >= min_rate))
+        return true;
+    fmt::println(stderr, "{} muss 0 (unbegrenzt) oder mindestens {} sein: {}", opt, min_rate, rate);
+    return false;
+}
+
+std::optional<Options> parse_options(int argc, char const *argv[]) {
+    static constexpr unsigned min_size = 16, max_size = 16384;
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool ok = true;
+        if (arg == "--headless")
+            o.headless = true;
+        else if (arg == "--frames")
+            ok = parse_value(argc, argv, i, o.frames);
+        else if (arg == "--size")
+            ok = parse_value(argc, argv, i, o.size);
+        else if (arg == "--sim-rate")
+            ok = parse_value(argc, argv, i, o.steps_per_second);
+        else if (arg == "--fps")
+            ok = parse_value(argc, argv, i, o.frames_per_second);
+        else {
+            fmt::println(stderr, "Unbekannte Option: {}", arg);
+            ok = false;
+        }
+        if (!ok)
+            return std::nullopt;
+    }
+    if (o.size < min_size || o.size > max_size) {
+        fmt::println(stderr, "--size muss zwischen {} und {} liegen: {}", min_size, max_size, o.size);
+        return std::nullopt;
+    }
+    if (!check_rate("--sim-rate", o.steps_per_second) || !check_rate("--fps", o.frames_per_second))
+        return std::nullopt;
+    return o;
+}
+
+Image<float> make_random_image(unsigned width, unsigned height) {
+    Image<float> img(width, height);
+    auto mk_randomizer = [](float max){
+        std::mt19937_64 gen(std::random_device{}());
+        std::uniform_real_distribution<float> dist(0, max);
+        auto rnd = std::bind(dist, gen);
+        return [rnd]() mutable { return rnd(); };
+    };
+    auto fgen = mk_randomizer(1.0f);
+    std::generate(img.begin(), img.end(), fgen);
+    return img;
+}
+
+void print_stats(Simulation<float> const & sim, PresentStats const & ps, float seconds) {
+    fmt::println("{:.2f}s: {} steps ({:.1f}/s), {} dropped, {} late; "
+        "{} frames presented, {} repeated, {} errors",
+        seconds, sim.steps(), sim.steps() / seconds, sim.dropped(), sim.late(),
+        ps.presented, ps.repeated, ps.errors);
+}
+
+/**
+ * @brief checks the counters of a finished run: every step and the initial
+ * image were either presented, dropped or are still pending, every frame
+ * either presented a new image or repeated the previous one, and no step was
+ * presented which the simulation had not computed
+ * @return     number of violated checks
+ */
+unsigned check_counters(Options const & o, Simulation<float> const & sim,
+                        PresentStats const & ps, bool pending) {
+    unsigned failed = 0;
+    if (1 + sim.steps() != ps.presented + sim.dropped() + (pending ? 1 : 0)) {
+        fmt::println(stderr, "Fehler: 1 + {} Schritte != {} angezeigt + {} verworfen + {} ausstehend",
+            sim.steps(), ps.presented, sim.dropped(), pending ? 1 : 0);
+        ++failed;
+    }
+    if (ps.presented + ps.repeated != o.frames) {
+        fmt::println(stderr, "Fehler: {} angezeigt + {} wiederholt != {} Frames",
+            ps.presented, ps.repeated, o.frames);
+        ++failed;
+    }
+    if (ps.last_seq > sim.steps()) {
+        fmt::println(stderr, "Fehler: Schritt {} angezeigt, aber nur {} Schritte berechnet",
+            ps.last_seq, sim.steps());
+        ++failed;
+    }
+    return failed;
+}
+
+/**
+ * @brief runs the pipeline without a window: the render thread only acquires
+ * and copies the latest image (in place of glTexImage2D) at the display rate.
+ * The mark of the front image must equal front_seq() before and after the
+ * copy, otherwise the simulation has written into the image held by the
+ * render thread.
+ */
+int run_headless(Options const & o) {
+    TripleBuffer<float> buffers(make_random_image(o.size, o.size));
+    Image<float> upload(o.size, o.size);
+    PresentStats ps;
+    uint64_t overwritten = 0;
+    Simulation<float> sim(buffers, o.steps_per_second);
+    Timer timer;
+    auto const frame_time = o.frames_per_second > 0.f
+        ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(1.f / o.frames_per_second))
+        : std::chrono::steady_clock::duration::zero();
+    auto next = std::chrono::steady_clock::now();
+    sim.start();
+    for (unsigned frame = 0; frame < o.frames; ++frame) {
+        if (ps.update(buffers)) {
+            auto const mark = buffers.front_mark();
+            std::copy(buffers.front().begin(), buffers.front().end(), upload.begin());
+            if (mark != buffers.front_seq() || buffers.front_mark() != buffers.front_seq())
+                ++overwritten;
+        }
+        if (frame_time == std::chrono::steady_clock::duration::zero())
+            continue;
+        next += frame_time;
+        std::this_thread::sleep_until(next);
+    }
+    sim.stop();
+    timer.stop();
+    print_stats(sim, ps, timer.seconds_total());
+    unsigned failed = check_counters(o, sim, ps, buffers.pending());
+    if (overwritten != 0)
+        fmt::println(stderr, "Fehler: {} Bilder während der Anzeige überschrieben", overwritten);
+    return ps.errors == 0 && overwritten == 0 && failed == 0 ? 0 : 1;
+}
+
 int main(int argc, char const *argv[]) {
+  auto parsed = parse_options(argc, argv);
+  if (!parsed)
+    return 1;
+  Options const & options = *parsed;
+  if (options.headless)
+    return run_headless(options);
+
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -128,19 +478,9 @@ int main(int argc, char const *argv[]) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-  int width = 1024;
-  int height = 1024;
-  Image<float> img1(width, height);
-  Image<float> img2(width, height);
-  auto mk_randomizer = [](float max){
-      std::mt19937_64 gen(std::random_device{}());
-      std::uniform_real_distribution<float> dist(0, max);
-      auto rnd = std::bind(dist, gen);
-      return [rnd]() mutable { return rnd(); };
-  };
-  auto fgen = mk_randomizer(1.0f);
-  std::generate(img1.begin(), img1.end(), fgen);
-  std::copy(img1.begin(), img1.end(), img2.begin());
+  int width = options.size;
+  int height = options.size;
+  TripleBuffer<float> buffers(make_random_image(width, height));
 
   // Erstelle Vertex Array Object (VAO) und Vertex Buffer Object (VBO)
   unsigned int VAO, VBO;
@@ -200,9 +540,9 @@ int main(int argc, char const *argv[]) {
 
   fmt::println(stderr, "glDeleteShader");
   Timer timer;
-
-  Image<float> *src = &img1;
-  Image<float> *tgt = &img2;
+  PresentStats ps;
+  Simulation<float> sim(buffers, options.steps_per_second);
+  sim.start();
 
   while (!glfwWindowShouldClose(window)) {
     timer.stop();
@@ -213,23 +553,22 @@ int main(int argc, char const *argv[]) {
     glUseProgram(shaderProgram);
 
     glBindTexture(GL_TEXTURE_2D, texture);
-    //compute_texture(width, height, data);
-    compute_image(src, tgt);
-    //fmt::println(stderr, "compute_image");
-    //glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, data.get());
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RED, GL_FLOAT, tgt->begin());
-    //glGenerateMipmap(GL_TEXTURE_2D);
-    //fmt::println(stderr, "glTexImage2D");
-    std::swap(src, tgt);
+    // only upload when the simulation has finished a new image
+    if (ps.update(buffers))
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RED, GL_FLOAT, buffers.front().begin());
     glBindVertexArray(VAO);
 
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, indices);
 
     glfwSwapBuffers(window);
-    float rest_time = 1.f/60.f - delta_time_s;
+    if (options.frames_per_second == 0.f)
+        continue;
+    float rest_time = 1.f/options.frames_per_second - delta_time_s;
     if (rest_time > 0.f)
         std::this_thread::sleep_for(std::chrono::duration<float>(rest_time));
   }
+  sim.stop();
+  print_stats(sim, ps, timer.seconds_total());
   glfwTerminate();
 
   return 0;
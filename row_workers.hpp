@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <barrier>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief splits height rows into at most max_bands bands (but at least 64 rows
+ * per band), each as [y_begin, y_end)
+ */
+inline std::vector<std::pair<unsigned, unsigned>> row_bands(unsigned height, unsigned max_bands) {
+    static constexpr unsigned min_rows_per_thread = 64;
+    unsigned threads = std::clamp(height / min_rows_per_thread, 1u, std::max(1u, max_bands));
+    unsigned band = (height + threads - 1) / threads;
+    std::vector<std::pair<unsigned, unsigned>> bands;
+    for (unsigned t = 0; t < threads; ++t) {
+        unsigned y0 = std::min(height, t * band);
+        bands.emplace_back(y0, std::min(height, y0 + band));
+    }
+    return bands;
+}
+
+/**
+ * @brief persistent workers for bands of rows. run(fn) calls fn(y_begin, y_end)
+ * once per band of row_bands(height, max_bands): band 0 on the calling thread,
+ * the others on workers which are started once and wait on a start and a
+ * finish barrier between calls, so no thread is created per frame.
+ * Only one thread at a time may call run().
+ */
+class RowWorkers {
+public:
+    using job_type = std::function<void(unsigned, unsigned)>;
+
+    explicit RowWorkers(unsigned height, unsigned max_bands)
+    : bands_{row_bands(height, max_bands)}
+    , start_(bands_.size()), finish_(bands_.size())
+    {
+        workers_.reserve(bands_.size() - 1);
+        for (size_t band = 1; band < bands_.size(); ++band)
+            workers_.emplace_back([this, band] { work(band); });
+    }
+    ~RowWorkers() {
+        // release the workers from the start barrier, they are joined by ~jthread
+        stopping_ = true;
+        start_.arrive_and_wait();
+    }
+    RowWorkers(RowWorkers const &) = delete;
+    RowWorkers& operator=(RowWorkers const &) = delete;
+
+    /// returns when fn has finished for all bands
+    void run(job_type const & fn) {
+        job_ = &fn;
+        start_.arrive_and_wait();
+        fn(bands_[0].first, bands_[0].second);
+        finish_.arrive_and_wait();
+        job_ = nullptr;
+    }
+
+    size_t bands() const noexcept { return bands_.size(); }
+
+protected:
+    void work(size_t band) {
+        for (;;) {
+            start_.arrive_and_wait();
+            if (stopping_)
+                return;
+            (*job_)(bands_[band].first, bands_[band].second);
+            finish_.arrive_and_wait();
+        }
+    }
+
+    std::vector<std::pair<unsigned, unsigned>> const bands_;
+    std::barrier<> start_, finish_;
+    job_type const * job_ = nullptr;
+    bool stopping_ = false;
+    std::vector<std::jthread> workers_;     // last: joined before the barriers go
+};
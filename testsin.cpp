@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cmath>
+#include <fmt/core.h>
+#include "fast_sin.hpp"
+#include <string_view>
+#include <vector>
+
+
+static constexpr float max_error = 1e-7f;
+static constexpr size_t SAMPLES = 1000000;
+static_assert(SAMPLES % 8 == 0, "sin_ps is tested 8 floats at a time");
+
+/**
+ * @brief largest |fn(x) - std::sin(x)| for SAMPLES points of [a, b]
+ */
+double max_sin_error(float a, float b, auto&& fn) {
+    std::vector<float> x(SAMPLES);
+    for (size_t i = 0; i < SAMPLES; ++i)
+        x[i] = a + (b - a) * (float) i / (float) (SAMPLES - 1);
+    std::vector<float> y(SAMPLES);
+    fn(x, y);
+    double err = 0.;
+    for (size_t i = 0; i < SAMPLES; ++i)
+        err = std::max(err, std::fabs((double) y[i] - std::sin((double) x[i])));
+    return err;
+}
+
+int test_sin(std::string_view desc, auto&& fn) {
+    // the last range is what compute_image in ogl2 passes
+    float const ranges[][2] = {{-M_PIf32, M_PIf32}, {-100.f, 100.f}, {-M_PIf32 / 2, 4 * M_PIf32}};
+    int failed = 0;
+    for (auto const & [a, b] : ranges) {
+        double err = max_sin_error(a, b, fn);
+        bool ok = err < max_error;
+        fmt::println("{:<10} {:<8} [{:9.4f}, {:9.4f}]: max error {:.3g}",
+            ok ? "OK" : "Error", desc, a, b, err);
+        failed += ok ? 0 : 1;
+    }
+    return failed;
+}
+
+int test_sin_table() {
+    // table entries may differ from sin_poly only by the rounding of i * step + phase
+    std::vector<float> t(1003);
+    float const step = 0.037f, phase = -20.f, scale = 0.5f, offset = 0.5f;
+    sin_table(t, step, phase, scale, offset);
+    double err = 0.;
+    for (size_t i = 0; i < t.size(); ++i)
+        err = std::max(err, std::fabs((double) t[i] - (offset + scale * std::sin((double) (i * step + phase)))));
+    bool ok = err < max_error;
+    fmt::println("{:<10} sin_table: max error {:.3g}", ok ? "OK" : "Error", err);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char const *argv[])
+{
+    int failed = test_sin("sin_poly", [](auto const & x, auto& y) {
+        std::transform(x.begin(), x.end(), y.begin(), sin_poly);
+    });
+#ifdef __AVX2__
+    failed += test_sin("sin_ps", [](auto const & x, auto& y) {
+        for (size_t i = 0; i < x.size(); i += 8)
+            _mm256_storeu_ps(&y[i], sin_ps(_mm256_loadu_ps(&x[i])));
+    });
+#endif
+    failed += test_sin_table();
+    return failed == 0 ? 0 : 1;
+}